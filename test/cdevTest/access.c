@@ -0,0 +1,171 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/errno.h>
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/device.h>
+#include <linux/err.h>
+#include <linux/sched.h>
+#include <linux/pid.h>
+#include <linux/cred.h>
+#include <linux/hashtable.h>
+#include <linux/mutex.h>
+
+#include "hello.h"
+
+/*
+ * 私有设备：每个打开者（或每个 uid/tgid）拥有自己的量子存储，
+ * 按 uid/tgid 区分时第一次打开创建并放入哈希表，按打开区分时直接分配，最后一个引用释放时销毁。
+ * 读写直接复用 hello_read()/hello_write()，不同存储之间不会争用信号量。
+ */
+
+int hello_priv_key = HELLO_PRIV_KEY_OPEN;
+module_param(hello_priv_key, int, S_IRUGO);
+
+struct hello_priv_dev {
+    struct hello_android_dev store; /*私有的量子存储*/
+    int count; /*引用这个存储的打开文件数*/
+    struct pid *owner; /*按 tgid 区分时持有进程的 pid 引用，pid 号被复用也不会找到这个存储*/
+    struct hlist_node node; /*按打开区分时不在哈希表中*/
+};
+
+static DEFINE_HASHTABLE(hello_priv_hash, HELLO_PRIV_HASH_BITS);
+static DEFINE_MUTEX(hello_priv_lock); /*只保护哈希表和 count，不在读写路径上*/
+
+static dev_t hello_priv_devno;
+static struct cdev hello_priv_cdev;
+static int hello_priv_added;
+
+static struct hello_priv_dev *hello_priv_alloc(unsigned int key, struct pid *owner){
+    struct hello_priv_dev *pdev;
+
+    printk(KERN_ALERT "Debug by andrea: create private store for key %u", key);
+    pdev = kzalloc(sizeof(struct hello_priv_dev), GFP_KERNEL);
+    if(!pdev)
+        return NULL;
+    pdev->store.access_key = key;
+    pdev->store.quantum = hello_quantum;
+    pdev->store.qset = hello_qset;
+    sema_init(&pdev->store.sem, 1);
+    pdev->owner = get_pid(owner);
+    return pdev;
+}
+
+/*调用者持有 hello_priv_lock*/
+static struct hello_priv_dev *hello_priv_lookfor_device(void){
+    struct hello_priv_dev *pdev;
+    struct pid *owner = NULL;
+    unsigned int key;
+
+    switch(hello_priv_key){
+    case HELLO_PRIV_KEY_UID:
+        key = from_kuid(&init_user_ns, current_uid());
+        break;
+    case HELLO_PRIV_KEY_TGID:
+        owner = task_tgid(current);
+        key = pid_nr(owner);
+        break;
+    default:
+        /*每次打开都是新的存储，不需要查找*/
+        return hello_priv_alloc(0, NULL);
+    }
+
+    hash_for_each_possible(hello_priv_hash, pdev, node, key){
+        if(pdev->store.access_key == key && pdev->owner == owner)
+            return pdev;
+    }
+
+    pdev = hello_priv_alloc(key, owner);
+    if(pdev)
+        hash_add(hello_priv_hash, &pdev->node, key);
+    return pdev;
+}
+
+static void hello_priv_put(struct hello_priv_dev *pdev){
+    if(--pdev->count)
+        return;
+    printk(KERN_ALERT "Debug by andrea: free private store for key %u", pdev->store.access_key);
+    hash_del(&pdev->node);
+    put_pid(pdev->owner);
+    hello_trim(&pdev->store);
+    kfree(pdev);
+}
+
+int hello_priv_open(struct inode *inode, struct file *filp){
+    struct hello_priv_dev *pdev;
+
+    mutex_lock(&hello_priv_lock);
+    pdev = hello_priv_lookfor_device();
+    if(!pdev){
+        mutex_unlock(&hello_priv_lock);
+        printk(KERN_WARNING "Debug by andrea: malloc private store fail");
+        return -ENOMEM;
+    }
+    pdev->count++;
+    mutex_unlock(&hello_priv_lock);
+
+    filp->private_data = &pdev->store;
+    if((filp->f_flags & O_ACCMODE) == O_WRONLY){
+        if(down_interruptible(&pdev->store.sem)){
+            mutex_lock(&hello_priv_lock);
+            hello_priv_put(pdev);
+            mutex_unlock(&hello_priv_lock);
+            return -ERESTARTSYS;
+        }
+        hello_trim(&pdev->store);
+        up(&pdev->store.sem);
+    }
+    return 0;
+}
+
+int hello_priv_release(struct inode *inode, struct file *filp){
+    struct hello_priv_dev *pdev;
+
+    pdev = container_of(filp->private_data, struct hello_priv_dev, store);
+    mutex_lock(&hello_priv_lock);
+    hello_priv_put(pdev);
+    mutex_unlock(&hello_priv_lock);
+    return 0;
+}
+
+struct file_operations hello_priv_fops = {
+    .owner  = THIS_MODULE,
+    .read   = hello_read,
+    .write  = hello_write,
+    .unlocked_ioctl = hello_ioctl,
+    .open   = hello_priv_open,
+    .release= hello_priv_release,
+};
+
+int hello_access_init(dev_t firstdev){
+    int err;
+    struct device *temp;
+
+    hello_priv_devno = firstdev;
+    cdev_init(&hello_priv_cdev, &hello_priv_fops);
+    hello_priv_cdev.owner = THIS_MODULE;
+    err = cdev_add(&hello_priv_cdev, firstdev, 1);
+    if(err){
+        printk(KERN_WARNING "Debug by andrea: Error %d adding hellopriv", err);
+        return err;
+    }
+    hello_priv_added = 1;
+
+    temp = device_create(hello_class, NULL, firstdev, NULL, "hellopriv");
+    if(IS_ERR(temp)){
+        printk(KERN_WARNING "Debug by andrea: Failed to create hellopriv");
+        hello_access_cleanup();
+        return PTR_ERR(temp);
+    }
+    return HELLO_PRIV_NR_DEVS;
+}
+
+/*模块卸载时所有文件都已关闭，哈希表应该已经为空*/
+void hello_access_cleanup(void){
+    if(!hello_priv_added)
+        return;
+    device_destroy(hello_class, hello_priv_devno);
+    cdev_del(&hello_priv_cdev);
+    hello_priv_added = 0;
+}
@@ -0,0 +1,246 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/errno.h>
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/err.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
+#include <asm/uaccess.h>
+
+#include "hello.h"
+
+/*
+ * 把存储的一段量子导出为 dma-buf，和 udmabuf 一样只用普通页，不需要真正的 DMA 硬件。
+ * dma-buf 持有每个量子的引用，设备之后的写入会走写时复制，
+ * 所以导出的内容不会再变，消费者 mmap 后直接读这些页，没有拷贝。
+ */
+
+MODULE_IMPORT_NS(DMA_BUF);
+
+struct hello_dmabuf {
+    int nr_quanta;
+    int nr_pages;
+    struct hello_quantum **quanta; /*持有引用，空洞为 NULL*/
+    struct page **pages; /*每页都持有引用*/
+    struct page *zero; /*空洞共用的零页*/
+};
+
+static vm_fault_t hello_dmabuf_fault(struct vm_fault *vmf){
+    struct hello_dmabuf *hbuf = vmf->vma->vm_private_data;
+
+    if(vmf->pgoff >= hbuf->nr_pages)
+        return VM_FAULT_SIGBUS;
+    vmf->page = hbuf->pages[vmf->pgoff];
+    get_page(vmf->page);
+    return 0;
+}
+
+static const struct vm_operations_struct hello_dmabuf_vm_ops = {
+    .fault = hello_dmabuf_fault,
+};
+
+static int hello_dmabuf_mmap(struct dma_buf *buf, struct vm_area_struct *vma){
+    if(vma->vm_flags & VM_WRITE)
+        return -EPERM;
+    vma->vm_ops = &hello_dmabuf_vm_ops;
+    vma->vm_private_data = buf->priv;
+    return 0;
+}
+
+static struct sg_table *hello_dmabuf_map(struct dma_buf_attachment *at,
+                                         enum dma_data_direction direction){
+    struct hello_dmabuf *hbuf = at->dmabuf->priv;
+    struct sg_table *sg;
+    int err;
+
+    /*设备只能从这些页读，不能 DMA 写入被快照或其他导出共享的量子*/
+    if(direction != DMA_TO_DEVICE)
+        return ERR_PTR(-EPERM);
+
+    sg = kzalloc(sizeof(*sg), GFP_KERNEL);
+    if(!sg)
+        return ERR_PTR(-ENOMEM);
+    err = sg_alloc_table_from_pages(sg, hbuf->pages, hbuf->nr_pages, 0,
+                                    (unsigned long)hbuf->nr_pages << PAGE_SHIFT,
+                                    GFP_KERNEL);
+    if(err)
+        goto err_free;
+    err = dma_map_sgtable(at->dev, sg, direction, 0);
+    if(err)
+        goto err_table;
+    return sg;
+
+err_table:
+    sg_free_table(sg);
+err_free:
+    kfree(sg);
+    return ERR_PTR(err);
+}
+
+static void hello_dmabuf_unmap(struct dma_buf_attachment *at,
+                               struct sg_table *sg,
+                               enum dma_data_direction direction){
+    dma_unmap_sgtable(at->dev, sg, direction, 0);
+    sg_free_table(sg);
+    kfree(sg);
+}
+
+static void hello_dmabuf_free(struct hello_dmabuf *hbuf){
+    int i;
+
+    for(i = 0; i < hbuf->nr_pages; i++){
+        if(hbuf->pages[i])
+            put_page(hbuf->pages[i]);
+    }
+    for(i = 0; i < hbuf->nr_quanta; i++){
+        hello_quantum_put(hbuf->quanta[i]);
+    }
+    if(hbuf->zero)
+        put_page(hbuf->zero);
+    kvfree(hbuf->pages);
+    kvfree(hbuf->quanta);
+    kfree(hbuf);
+}
+
+static void hello_dmabuf_release(struct dma_buf *buf){
+    hello_dmabuf_free(buf->priv);
+}
+
+static const struct dma_buf_ops hello_dmabuf_ops = {
+    .map_dma_buf   = hello_dmabuf_map,
+    .unmap_dma_buf = hello_dmabuf_unmap,
+    .release       = hello_dmabuf_release,
+    .mmap          = hello_dmabuf_mmap,
+};
+
+/*调用者持有 dev->sem，收集 [first, first + nr_quanta) 这些量子和它们的页*/
+static int hello_dmabuf_fill(struct hello_dmabuf *hbuf,
+                             struct hello_android_dev *dev,
+                             long first, int ppq){
+    struct hello_qset *dptr;
+    struct hello_quantum *q;
+    struct page *page;
+    int i, p, s_pos;
+
+    dptr = hello_lookup(dev, first / dev->qset);
+    s_pos = first % dev->qset;
+    for(i = 0; i < hbuf->nr_quanta; i++){
+        q = (dptr && dptr->data) ? dptr->data[s_pos] : NULL;
+        if(q)
+            refcount_inc(&q->ref);
+        hbuf->quanta[i] = q;
+        for(p = 0; p < ppq; p++){
+            if(q){
+                page = hello_quantum_page(q, p);
+                if(IS_ERR(page))
+                    return PTR_ERR(page);
+            } else {
+                if(!hbuf->zero){
+                    hbuf->zero = alloc_page(GFP_KERNEL | __GFP_ZERO);
+                    if(!hbuf->zero)
+                        return -ENOMEM;
+                }
+                page = hbuf->zero;
+                get_page(page);
+            }
+            hbuf->pages[i * ppq + p] = page;
+        }
+        if(++s_pos == dev->qset){
+            s_pos = 0;
+            dptr = dptr ? dptr->next : NULL;
+        }
+    }
+    return 0;
+}
+
+int hello_export(struct hello_android_dev *dev,
+                 struct hello_export __user *uarg){
+    DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+    struct hello_export arg;
+    struct hello_dmabuf *hbuf;
+    struct dma_buf *buf;
+    int quantum, ppq, err, fd;
+    long nr_quanta;
+
+    if(copy_from_user(&arg, uarg, sizeof(arg)))
+        return -EFAULT;
+    if(arg.flags & ~O_CLOEXEC)
+        return -EINVAL;
+
+    hbuf = kzalloc(sizeof(*hbuf), GFP_KERNEL);
+    if(!hbuf)
+        return -ENOMEM;
+
+    if(down_interruptible(&dev->sem)){
+        kfree(hbuf);
+        return -ERESTARTSYS;
+    }
+    quantum = dev->quantum;
+    ppq = DIV_ROUND_UP(quantum, PAGE_SIZE);
+    if(!arg.len || arg.offset >= dev->size || (unsigned long)arg.offset % quantum){
+        err = -EINVAL;
+        goto out_unlock;
+    }
+    if(arg.len > dev->size - arg.offset)
+        arg.len = dev->size - arg.offset;
+    nr_quanta = DIV_ROUND_UP((unsigned long)arg.len, quantum);
+    if(nr_quanta > INT_MAX / ppq){
+        err = -E2BIG;
+        goto out_unlock;
+    }
+
+    hbuf->quanta = kvcalloc(nr_quanta, sizeof(*hbuf->quanta), GFP_KERNEL);
+    hbuf->pages = kvcalloc(nr_quanta * ppq, sizeof(*hbuf->pages), GFP_KERNEL);
+    if(!hbuf->quanta || !hbuf->pages){
+        err = -ENOMEM;
+        goto out_unlock;
+    }
+    hbuf->nr_quanta = nr_quanta;
+    hbuf->nr_pages = nr_quanta * ppq;
+    err = hello_dmabuf_fill(hbuf, dev, (unsigned long)arg.offset / quantum, ppq);
+    if(err)
+        goto out_unlock;
+    up(&dev->sem);
+
+    /*只读导出，消费者不能通过映射改写被快照共享的量子*/
+    exp_info.ops = &hello_dmabuf_ops;
+    exp_info.size = (size_t)hbuf->nr_pages << PAGE_SHIFT;
+    exp_info.flags = O_RDONLY;
+    exp_info.priv = hbuf;
+
+    /*先预留 fd，结果拷回用户空间成功后才安装，失败时调用者不会拿到看不见的 fd*/
+    fd = get_unused_fd_flags(arg.flags & O_CLOEXEC);
+    if(fd < 0){
+        hello_dmabuf_free(hbuf);
+        return fd;
+    }
+    buf = dma_buf_export(&exp_info);
+    if(IS_ERR(buf)){
+        printk(KERN_WARNING "Debug by andrea: dma-buf export fail");
+        put_unused_fd(fd);
+        hello_dmabuf_free(hbuf);
+        return PTR_ERR(buf);
+    }
+
+    arg.fd = fd;
+    arg.stride = ppq << PAGE_SHIFT;
+    arg.size = exp_info.size;
+    if(copy_to_user(uarg, &arg, sizeof(arg))){
+        put_unused_fd(fd);
+        /*release 回调会释放 hbuf*/
+        dma_buf_put(buf);
+        return -EFAULT;
+    }
+    fd_install(fd, buf->file);
+    return 0;
+
+out_unlock:
+    up(&dev->sem);
+    hello_dmabuf_free(hbuf);
+    return err;
+}
@@ -3,6 +3,10 @@
 
 #include <linux/cdev.h>
 #include <linux/semaphore.h>
+#include <linux/types.h>
+#include <linux/refcount.h>
+#include <linux/ioctl.h>
+#include <linux/mm_types.h>
 
 #define HELLO_DEVICE_NODE_NAME  "hello"
 #define HELLO_DEVICE_FILE_NAME  "hello"
@@ -14,7 +18,7 @@
 #endif
 
 #ifndef HELLO_NR_DEVS
-#define HELLO_NR_DEVS 1
+#define HELLO_NR_DEVS 2
 #endif
 
 #ifndef HELLO_P_NR_DEVS
@@ -33,15 +37,51 @@
 #define HELLO_P_BUFFER 4000
 #endif
 
+#ifndef HELLO_LOG_NR_DEVS
+#define HELLO_LOG_NR_DEVS 1
+#endif
+
+#ifndef HELLO_LOG_QUANTA
+#define HELLO_LOG_QUANTA 256 /*每个CPU最多占用的量子数，用满后覆盖最旧的*/
+#endif
+
+#ifndef HELLO_PRIV_NR_DEVS
+#define HELLO_PRIV_NR_DEVS 1
+#endif
+
+#ifndef HELLO_PRIV_HASH_BITS
+#define HELLO_PRIV_HASH_BITS 6
+#endif
+
+/*私有设备按什么区分存储*/
+#define HELLO_PRIV_KEY_OPEN 0 /*每次打开一个存储*/
+#define HELLO_PRIV_KEY_UID  1 /*每个用户一个存储*/
+#define HELLO_PRIV_KEY_TGID 2 /*每个进程一个存储*/
+
+/*
+ * 日志设备的文件偏移：高位选择数据流，0 为按时间合并的流，
+ * HELLO_LOG_CPU_POS(cpu) 为该CPU自己的流，低位为该流中已读的字节数
+ */
+#define HELLO_LOG_POS_SHIFT   40
+#define HELLO_LOG_CPU_POS(cpu) ((loff_t)((cpu) + 1) << HELLO_LOG_POS_SHIFT)
+
 extern int hello_major;
 extern int hello_nr_devs;
 extern int hello_quantum;
 extern int hello_qset;
+extern bool hello_shmem;
+extern int hello_log_nr_devs;
+
+extern struct class *hello_class;
 
-static int __init hello_init(void);
-static void __exit hello_exit(void);
 void hello_cleanup_module(void);
 
+int hello_log_init(dev_t firstdev);
+void hello_log_cleanup(void);
+
+int hello_access_init(dev_t firstdev);
+void hello_access_cleanup(void);
+
 ssize_t hello_read(struct file *filp,
                     char __user *buf,
                     size_t count,
@@ -58,9 +98,50 @@ int hello_open(struct inode *inode,
 int hello_release(struct inode *inode,
                       struct file *filp);
 
+long hello_ioctl(struct file *filp,
+                 unsigned int cmd,
+                 unsigned long arg);
+
+/*
+ * ioctl 命令
+ * T 表示直接用 arg 的值传参
+ */
+#define HELLO_IOC_MAGIC 'k'
+
+/*把当前设备快照到 arg 指定的从设备，写时复制*/
+#define HELLO_IOCTSNAPSHOT _IO(HELLO_IOC_MAGIC, 1)
+
+/*
+ * 把 [offset, offset + len) 导出为只读的 dma-buf，offset 必须按量子对齐。
+ * 每个量子在 dma-buf 中占 stride 字节（量子大小向上取整到页），
+ * 导出的内容是当时的快照，之后对设备的写入会先复制量子
+ */
+struct hello_export {
+    __u64 offset; /*输入*/
+    __u64 len;    /*输入，超过数据量时截断*/
+    __u32 flags;  /*输入，只支持 O_CLOEXEC*/
+    __s32 fd;     /*输出，dma-buf 文件描述符*/
+    __u32 stride; /*输出*/
+    __u32 pad;
+    __u64 size;   /*输出，dma-buf 的大小*/
+};
+
+#define HELLO_IOCEXPORT _IOWR(HELLO_IOC_MAGIC, 2, struct hello_export)
+
+#define HELLO_IOC_MAXNR 2
+
+struct hello_quantum{
+    refcount_t ref; /*被几个量子集引用*/
+    void *data; /*非 shmem 模式下的量子数据，按页分配*/
+    struct file *shm; /*shmem 模式下量子所在的文件*/
+    pgoff_t index; /*shmem 模式下量子的第一页*/
+    int nr_pages; /*量子占用的页数*/
+};
+
 struct hello_qset{
-    void **data;
+    struct hello_quantum **data;
     struct hello_qset *next;
+    refcount_t ref; /*被几个设备或前一个量子集引用*/
 };
 
 struct hello_android_dev {
@@ -69,8 +150,27 @@ struct hello_android_dev {
     int qset; /*当前量子集大小*/
     unsigned long size; /*存放在这里的数据量*/
     unsigned int access_key; /*被sculluid和scullpriv使用*/
+    struct file *shm; /*shmem 模式下新量子所在的文件*/
+    pgoff_t shm_next; /*shmem 文件中下一个空闲页*/
     struct semaphore sem; /*互斥信号量*/
     struct cdev cdev; /*cdev 结构体*/
 };
 
+/*日志设备中每条记录的头部，read() 返回的数据即为头部加负载*/
+struct hello_log_rec {
+    __u64 ts;  /*写入时的单调时钟，纳秒*/
+    __u32 len; /*负载长度*/
+    __u16 cpu; /*写入该记录的CPU*/
+    __u16 pad;
+};
+
+int hello_trim(struct hello_android_dev *dev);
+struct hello_qset *hello_lookup(struct hello_android_dev *dev, int n);
+
+void hello_quantum_put(struct hello_quantum *q);
+struct page *hello_quantum_page(struct hello_quantum *q, int i);
+
+int hello_export(struct hello_android_dev *dev,
+                 struct hello_export __user *uarg);
+
 #endif
@@ -0,0 +1,481 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/errno.h>
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/device.h>
+#include <linux/err.h>
+#include <linux/percpu.h>
+#include <linux/percpu-rwsem.h>
+#include <linux/mutex.h>
+#include <linux/timekeeping.h>
+#include <linux/ratelimit.h>
+#include <asm/uaccess.h>
+
+#include "hello.h"
+
+/*
+ * 日志设备：每个CPU只往自己的量子链表尾部追加记录，写者之间没有锁。
+ * 写者在关抢占期间预留并提交记录，提交时用 release 语义发布 used，
+ * 读者用 acquire 语义读取，因此读者不会阻塞写者。
+ * 每个CPU的量子数到达上限后，和 ftrace 的环形缓冲区一样回收最旧的量子，
+ * 量子的 seq 随之加一，落后的读者据此发现记录已被覆盖，跳到最旧的记录继续读。
+ */
+
+#if HELLO_LOG_QUANTA < 2
+#error "HELLO_LOG_QUANTA must be at least 2 so the oldest quantum can be recycled"
+#endif
+
+#define HELLO_LOG_ALIGN(x) ALIGN((x), sizeof(__u64))
+
+int hello_log_nr_devs = HELLO_LOG_NR_DEVS;
+int hello_log_quanta = HELLO_LOG_QUANTA;
+
+struct hello_log_quantum {
+    struct hello_log_quantum *next; /*下一个量子，发布后不再改变*/
+    unsigned long used; /*已提交的字节数*/
+    unsigned long seq; /*被回收的次数*/
+    char data[];
+};
+
+struct hello_log_cpu {
+    struct hello_log_quantum *head; /*第一个量子*/
+    struct hello_log_quantum *tail; /*当前追加的量子，只由本CPU访问*/
+    int nr_quanta;
+};
+
+struct hello_log_dev {
+    struct hello_log_cpu __percpu *cpus;
+    struct percpu_rw_semaphore rwsem; /*读写者共享，清空日志时独占*/
+    unsigned long gen; /*清空次数，用于让读者的游标失效*/
+    struct cdev cdev;
+};
+
+struct hello_log_cursor {
+    struct hello_log_quantum *q;
+    unsigned long seq; /*读到 q 时它的 seq，不相等说明已被回收*/
+    unsigned int off;
+};
+
+/*每个打开的文件各自的读游标*/
+struct hello_log_reader {
+    struct hello_log_dev *dev;
+    struct mutex lock;
+    unsigned long gen;
+    int cpu; /*-1 表示合并流*/
+    loff_t pos; /*游标对应的文件偏移*/
+    struct hello_log_cursor cur[];
+};
+
+static dev_t hello_log_devno;
+static struct hello_log_dev *hello_log_devices;
+
+/*记录按8字节对齐且不跨量子*/
+static int hello_log_max_record(void){
+    return ALIGN_DOWN(hello_quantum, sizeof(__u64)) - sizeof(struct hello_log_rec);
+}
+
+static void hello_log_reset_cursors(struct hello_log_reader *rd){
+    memset(rd->cur, 0, nr_cpu_ids * sizeof(struct hello_log_cursor));
+    rd->gen = rd->dev->gen;
+}
+
+/*按文件偏移选择数据流，只能定位到流的开头或游标当前的位置*/
+static int hello_log_select(struct hello_log_reader *rd, loff_t pos){
+    int cpu = (int)(pos >> HELLO_LOG_POS_SHIFT) - 1;
+    loff_t off = pos & (HELLO_LOG_CPU_POS(0) - 1);
+
+    if(pos == rd->pos)
+        return 0;
+    if(off || cpu >= (int)nr_cpu_ids || (cpu >= 0 && !cpu_possible(cpu)))
+        return -EINVAL;
+    rd->cpu = cpu;
+    rd->pos = pos;
+    hello_log_reset_cursors(rd);
+    return 0;
+}
+
+/*从该CPU最旧的量子重新开始*/
+static struct hello_log_quantum *hello_log_rewind(struct hello_log_dev *dev,
+                                                 struct hello_log_cursor *cur,
+                                                 int cpu){
+    struct hello_log_quantum *q;
+
+    q = smp_load_acquire(&per_cpu_ptr(dev->cpus, cpu)->head);
+    cur->q = q;
+    cur->off = 0;
+    if(q)
+        cur->seq = smp_load_acquire(&q->seq);
+    return q;
+}
+
+/*游标所在的量子是否已被写者回收*/
+static int hello_log_overwritten(struct hello_log_cursor *cur){
+    smp_rmb();
+    return READ_ONCE(cur->q->seq) != cur->seq;
+}
+
+/*返回该CPU上游标所指的下一条已提交记录，没有则返回 NULL*/
+static struct hello_log_rec *hello_log_peek(struct hello_log_dev *dev,
+                                            struct hello_log_cursor *cur,
+                                            int cpu){
+    struct hello_log_quantum *q = cur->q, *next;
+    unsigned long used;
+
+    if(!q){
+        q = hello_log_rewind(dev, cur, cpu);
+        if(!q)
+            return NULL;
+    }
+    for(;;){
+        used = smp_load_acquire(&q->used);
+        if(hello_log_overwritten(cur)){
+            printk_ratelimited(KERN_WARNING "Debug by andrea: log reader is overrun on cpu %d", cpu);
+            q = hello_log_rewind(dev, cur, cpu);
+            if(!q)
+                return NULL;
+            continue;
+        }
+        if(cur->off < used)
+            return (struct hello_log_rec *)(q->data + cur->off);
+        next = smp_load_acquire(&q->next);
+        if(!next)
+            return NULL;
+        /*q 可能在读 next 之前被回收，此时 next 是新的尾部，要从最旧的量子重读*/
+        if(hello_log_overwritten(cur))
+            continue;
+        /*next 发布之后 used 不会再变，重新检查一次*/
+        if(cur->off < READ_ONCE(q->used))
+            continue;
+        cur->q = q = next;
+        cur->seq = smp_load_acquire(&q->seq);
+        cur->off = 0;
+    }
+}
+
+static void hello_log_free(struct hello_log_dev *dev){
+    struct hello_log_quantum *q, *next;
+    struct hello_log_cpu *lc;
+    int cpu;
+
+    for_each_possible_cpu(cpu){
+        lc = per_cpu_ptr(dev->cpus, cpu);
+        for(q = lc->head; q; q = next){
+            next = q->next;
+            kfree(q);
+        }
+        lc->head = lc->tail = NULL;
+        lc->nr_quanta = 0;
+    }
+    dev->gen++;
+}
+
+int hello_log_open(struct inode *inode, struct file *filp){
+    struct hello_log_dev *dev;
+    struct hello_log_reader *rd;
+
+    dev = container_of(inode->i_cdev, struct hello_log_dev, cdev);
+    rd = kzalloc(sizeof(*rd) + nr_cpu_ids * sizeof(struct hello_log_cursor),
+                 GFP_KERNEL);
+    if(!rd){
+        printk(KERN_WARNING "Debug by andrea: malloc log reader fail");
+        return -ENOMEM;
+    }
+    rd->dev = dev;
+    rd->cpu = -1;
+    mutex_init(&rd->lock);
+
+    /*和普通文件一样，O_TRUNC 清空日志，追加写请用 O_APPEND*/
+    if((filp->f_flags & O_ACCMODE) != O_RDONLY && (filp->f_flags & O_TRUNC)){
+        percpu_down_write(&dev->rwsem);
+        hello_log_free(dev);
+        percpu_up_write(&dev->rwsem);
+    }
+    rd->gen = dev->gen;
+    filp->private_data = rd;
+    return 0;
+}
+
+int hello_log_release(struct inode *inode, struct file *filp){
+    kfree(filp->private_data);
+    return 0;
+}
+
+loff_t hello_log_llseek(struct file *filp, loff_t off, int whence){
+    struct hello_log_reader *rd = filp->private_data;
+    int err;
+
+    /*支持 lseek(fd, 0, SEEK_CUR)，方便 ftell 查询当前位置*/
+    if(whence == SEEK_CUR && off == 0){
+        mutex_lock(&rd->lock);
+        off = rd->pos;
+        mutex_unlock(&rd->lock);
+        return off;
+    }
+    if(whence != SEEK_SET)
+        return -EINVAL;
+    mutex_lock(&rd->lock);
+    err = hello_log_select(rd, off);
+    if(!err)
+        filp->f_pos = off;
+    mutex_unlock(&rd->lock);
+    return err ? err : off;
+}
+
+ssize_t hello_log_read(struct file *filp,
+                       char __user *buf,
+                       size_t count,
+                       loff_t *f_pos){
+    struct hello_log_reader *rd = filp->private_data;
+    struct hello_log_dev *dev = rd->dev;
+    struct hello_log_rec *rec, *best;
+    size_t size, done = 0;
+    ssize_t retval = 0;
+    int cpu, best_cpu;
+
+    if(mutex_lock_interruptible(&rd->lock))
+        return -ERESTARTSYS;
+    retval = hello_log_select(rd, *f_pos);
+    if(retval)
+        goto out_unlock;
+    percpu_down_read(&dev->rwsem);
+    if(rd->gen != dev->gen)
+        hello_log_reset_cursors(rd);
+
+    for(;;){
+        best = NULL;
+        best_cpu = -1;
+        if(rd->cpu >= 0){
+            best = hello_log_peek(dev, &rd->cur[rd->cpu], rd->cpu);
+            best_cpu = rd->cpu;
+        } else {
+            for_each_possible_cpu(cpu){
+                rec = hello_log_peek(dev, &rd->cur[cpu], cpu);
+                if(rec && (!best || rec->ts < best->ts)){
+                    best = rec;
+                    best_cpu = cpu;
+                }
+            }
+        }
+        if(!best)
+            break;
+        /*只返回完整的记录，len 可能是正在被覆盖的数据，先限制在量子以内*/
+        size = sizeof(*best) + READ_ONCE(best->len);
+        if(rd->cur[best_cpu].off + size > hello_quantum){
+            hello_log_rewind(dev, &rd->cur[best_cpu], best_cpu);
+            continue;
+        }
+        if(size > count - done){
+            if(!done)
+                retval = -EINVAL;
+            break;
+        }
+        if(copy_to_user(buf + done, best, size)){
+            printk(KERN_WARNING "Debug by andrea: log read fail");
+            retval = -EFAULT;
+            break;
+        }
+        /*拷贝期间量子被回收，刚拷出的数据作废*/
+        if(hello_log_overwritten(&rd->cur[best_cpu])){
+            hello_log_rewind(dev, &rd->cur[best_cpu], best_cpu);
+            continue;
+        }
+        rd->cur[best_cpu].off += HELLO_LOG_ALIGN(size);
+        done += size;
+    }
+    percpu_up_read(&dev->rwsem);
+
+    if(done){
+        *f_pos += done;
+        rd->pos = *f_pos;
+        retval = done;
+    }
+out_unlock:
+    mutex_unlock(&rd->lock);
+    return retval;
+}
+
+ssize_t hello_log_write(struct file *filp,
+                        const char __user *buf,
+                        size_t count,
+                        loff_t *f_pos){
+    struct hello_log_reader *rd = filp->private_data;
+    struct hello_log_dev *dev = rd->dev;
+    struct hello_log_quantum *q, *spare = NULL;
+    struct hello_log_cpu *lc;
+    struct hello_log_rec *rec;
+    unsigned long need;
+    char *payload;
+    ssize_t retval;
+
+    if(count > hello_log_max_record()){
+        printk(KERN_ALERT "Debug by andrea: log record is too long, only write one quantum");
+        count = hello_log_max_record();
+    }
+    if(!count)
+        return 0;
+    need = HELLO_LOG_ALIGN(sizeof(*rec) + count);
+
+    /*关抢占时不能访问用户空间，先拷贝到内核*/
+    payload = kmalloc(count, GFP_KERNEL);
+    if(!payload)
+        return -ENOMEM;
+    if(copy_from_user(payload, buf, count)){
+        printk(KERN_WARNING "Debug by andrea: log write fail");
+        retval = -EFAULT;
+        goto out_free;
+    }
+
+    percpu_down_read(&dev->rwsem);
+    for(;;){
+        lc = get_cpu_ptr(dev->cpus);
+        q = lc->tail;
+        if(q && q->used + need <= hello_quantum)
+            break;
+        if(lc->nr_quanta >= hello_log_quanta){
+            /*
+             * 回收最旧的量子接到链表尾部。量子只在清空日志时释放，
+             * 读者手里的指针始终有效，只需先增加 seq 再重置内容
+             */
+            q = lc->head;
+            smp_store_release(&lc->head, q->next);
+            WRITE_ONCE(q->seq, q->seq + 1);
+            smp_wmb();
+            WRITE_ONCE(q->next, NULL);
+            smp_store_release(&q->used, 0);
+            smp_store_release(&lc->tail->next, q);
+            lc->tail = q;
+            break;
+        }
+        if(spare){
+            /*先初始化再发布，读者只会看到完整的量子*/
+            if(lc->tail)
+                smp_store_release(&lc->tail->next, spare);
+            else
+                smp_store_release(&lc->head, spare);
+            lc->tail = q = spare;
+            lc->nr_quanta++;
+            spare = NULL;
+            break;
+        }
+        /*本CPU的量子已满，开抢占后分配一个新的再重试，期间可能换了CPU*/
+        put_cpu_ptr(dev->cpus);
+        spare = kmalloc(sizeof(*spare) + hello_quantum, GFP_KERNEL);
+        if(!spare){
+            printk(KERN_WARNING "Debug by andrea: log quantum malloc fail");
+            retval = -ENOMEM;
+            goto out_unlock;
+        }
+        spare->next = NULL;
+        spare->used = 0;
+        spare->seq = 0;
+    }
+
+    rec = (struct hello_log_rec *)(q->data + q->used);
+    rec->ts = ktime_get_mono_fast_ns();
+    rec->len = count;
+    rec->cpu = smp_processor_id();
+    rec->pad = 0;
+    memcpy(rec + 1, payload, count);
+    smp_store_release(&q->used, q->used + need);
+    put_cpu_ptr(dev->cpus);
+    retval = count;
+
+out_unlock:
+    percpu_up_read(&dev->rwsem);
+    kfree(spare);
+out_free:
+    kfree(payload);
+    return retval;
+}
+
+struct file_operations hello_log_fops = {
+    .owner  = THIS_MODULE,
+    .llseek = hello_log_llseek,
+    .read   = hello_log_read,
+    .write  = hello_log_write,
+    .open   = hello_log_open,
+    .release= hello_log_release,
+};
+
+static void hello_log_free_dev(struct hello_log_dev *dev){
+    if(!dev->cpus)
+        return;
+    hello_log_free(dev);
+    percpu_free_rwsem(&dev->rwsem);
+    free_percpu(dev->cpus);
+    dev->cpus = NULL;
+}
+
+static int hello_log_setup_dev(struct hello_log_dev *dev, int index){
+    int err;
+    dev_t devno = hello_log_devno + index;
+    struct device *temp;
+
+    dev->cpus = alloc_percpu(struct hello_log_cpu);
+    if(!dev->cpus)
+        return -ENOMEM;
+    err = percpu_init_rwsem(&dev->rwsem);
+    if(err){
+        free_percpu(dev->cpus);
+        dev->cpus = NULL;
+        return err;
+    }
+
+    cdev_init(&dev->cdev, &hello_log_fops);
+    dev->cdev.owner = THIS_MODULE;
+    err = cdev_add(&dev->cdev, devno, 1);
+    if(err){
+        printk(KERN_WARNING "Debug by andrea: Error %d adding hellolog %d", err, index);
+        hello_log_free_dev(dev);
+        return err;
+    }
+
+    temp = device_create(hello_class, NULL, devno, NULL, "hellolog%d", index);
+    if(IS_ERR(temp)){
+        printk(KERN_WARNING "Debug by andrea: Failed to create hellolog %d", index);
+        cdev_del(&dev->cdev);
+        hello_log_free_dev(dev);
+        return PTR_ERR(temp);
+    }
+    return 0;
+}
+
+int hello_log_init(dev_t firstdev){
+    int i, err;
+
+    hello_log_devno = firstdev;
+    hello_log_devices = kcalloc(hello_log_nr_devs,
+                                sizeof(struct hello_log_dev), GFP_KERNEL);
+    if(!hello_log_devices){
+        printk(KERN_WARNING "Debug by andrea: malloc hello_log_dev fail");
+        return -ENOMEM;
+    }
+    for(i = 0; i < hello_log_nr_devs; i++){
+        err = hello_log_setup_dev(hello_log_devices + i, i);
+        if(err){
+            hello_log_cleanup();
+            return err;
+        }
+    }
+    return hello_log_nr_devs;
+}
+
+void hello_log_cleanup(void){
+    int i;
+    struct hello_log_dev *dev;
+
+    if(!hello_log_devices)
+        return;
+    for(i = 0; i < hello_log_nr_devs; i++){
+        dev = hello_log_devices + i;
+        if(!dev->cpus)
+            continue;
+        device_destroy(hello_class, hello_log_devno + i);
+        cdev_del(&dev->cdev);
+        hello_log_free_dev(dev);
+    }
+    kfree(hello_log_devices);
+    hello_log_devices = NULL;
+}
@@ -0,0 +1,1069 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/errno.h>
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/device.h>
+#include <linux/err.h>
+#include <linux/refcount.h>
+#include <linux/capability.h>
+#include <linux/shmem_fs.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/proc_fs.h>
+#include <linux/xarray.h>
+#include <linux/rcupdate.h>
+#include <linux/seq_file.h>
+#include <asm/uaccess.h>
+
+#include "hello.h"
+
+int hello_major = HELLO_MAJOR;
+int hello_minor = 0;
+int hello_nr_devs = HELLO_NR_DEVS;
+
+int hello_quantum = HELLO_QUANTUM;
+int hello_qset = HELLO_QSET;
+bool hello_shmem = false; /*量子是否放在 shmem 文件中，可被换出*/
+
+module_param(hello_major, int, S_IRUGO);
+module_param(hello_nr_devs, int, S_IRUGO);
+module_param(hello_quantum, int, S_IRUGO);
+module_param(hello_qset, int, S_IRUGO);
+module_param(hello_shmem, bool, S_IRUGO);
+
+struct class *hello_class;
+struct hello_android_dev *hello_dev;
+static struct proc_dir_entry *hello_proc_entry;
+
+MODULE_AUTHOR("Andrea Ji");
+MODULE_DESCRIPTION("First Android Driver");
+MODULE_LICENSE("Dual BSD/GPL");
+
+static int __init hello_init(void);
+static void __exit hello_exit(void);
+
+/*普通设备、日志设备、私有设备依次占用的从设备号总数*/
+static int hello_total_devs(void){
+    return hello_nr_devs + hello_log_nr_devs + HELLO_PRIV_NR_DEVS;
+}
+
+/*设备文件操作方法表*/
+struct file_operations hello_fops = {
+    .owner  = THIS_MODULE,
+    .read   = hello_read,
+    .write  = hello_write,
+    .unlocked_ioctl = hello_ioctl,
+    .open   = hello_open,
+    .release= hello_release,
+};
+
+/*
+ * 量子集和量子都带引用计数，快照只共享链表头，写入时才复制（写时复制）。
+ * 只有引用计数为1的量子集或量子才能原地修改。
+ */
+static int hello_exclusive(refcount_t *ref){
+    if(refcount_read(ref) != 1)
+        return 0;
+    /*其他设备的 put 在释放前已读完数据*/
+    smp_acquire__after_ctrl_dep();
+    return 1;
+}
+
+/*
+ * 量子按整页分配，以便导出为 dma-buf 后能直接映射到用户空间。
+ * shmem 模式下每个量子占用 shmem 文件中连续的几页，页号只增不减，
+ * 量子释放时在文件上打洞，页和交换空间都还给系统
+ */
+static struct hello_quantum *hello_quantum_alloc(struct hello_android_dev *dev){
+    struct hello_quantum *q;
+
+    q = kzalloc(sizeof(struct hello_quantum), GFP_KERNEL);
+    if(!q)
+        return NULL;
+    q->nr_pages = DIV_ROUND_UP(dev->quantum, PAGE_SIZE);
+    if(hello_shmem){
+        if(!dev->shm){
+            dev->shm = shmem_file_setup("hello", MAX_LFS_FILESIZE, VM_NORESERVE);
+            if(IS_ERR(dev->shm)){
+                printk(KERN_WARNING "Debug by andrea: shmem file setup fail");
+                dev->shm = NULL;
+                kfree(q);
+                return NULL;
+            }
+            dev->shm_next = 0;
+        }
+        q->shm = get_file(dev->shm);
+        q->index = dev->shm_next;
+        dev->shm_next += q->nr_pages;
+    } else {
+        /*清零，避免页尾的填充字节通过 mmap 泄露内核数据*/
+        q->data = alloc_pages_exact(q->nr_pages << PAGE_SHIFT, GFP_KERNEL | __GFP_ZERO);
+        if(!q->data){
+            kfree(q);
+            return NULL;
+        }
+    }
+    refcount_set(&q->ref, 1);
+    return q;
+}
+
+void hello_quantum_put(struct hello_quantum *q){
+    loff_t start;
+
+    if(q && refcount_dec_and_test(&q->ref)){
+        if(q->shm){
+            start = (loff_t)q->index << PAGE_SHIFT;
+            shmem_truncate_range(file_inode(q->shm), start,
+                                 start + ((loff_t)q->nr_pages << PAGE_SHIFT) - 1);
+            fput(q->shm);
+        }
+        if(q->data)
+            free_pages_exact(q->data, q->nr_pages << PAGE_SHIFT);
+        kfree(q);
+    }
+}
+
+/*返回量子的第 i 页并增加页的引用计数*/
+struct page *hello_quantum_page(struct hello_quantum *q, int i){
+    struct page *page;
+
+    if(q->shm)
+        return shmem_read_mapping_page(q->shm->f_mapping, q->index + i);
+    page = virt_to_page(q->data + ((size_t)i << PAGE_SHIFT));
+    get_page(page);
+    return page;
+}
+
+/*在量子的 [off, off + count) 和用户缓冲区之间拷贝，shmem 模式下逐页经过页缓存*/
+static int hello_quantum_copy_user(struct hello_quantum *q, int off,
+                                   char __user *buf, size_t count,
+                                   int to_user){
+    struct page *page;
+    char *kaddr;
+    size_t chunk, poff;
+    unsigned long left;
+
+    if(!q->shm){
+        if(to_user)
+            left = copy_to_user(buf, q->data + off, count);
+        else
+            left = copy_from_user(q->data + off, buf, count);
+        return left ? -EFAULT : 0;
+    }
+
+    while(count){
+        poff = off % PAGE_SIZE;
+        chunk = min_t(size_t, count, PAGE_SIZE - poff);
+        page = shmem_read_mapping_page(q->shm->f_mapping, q->index + off / PAGE_SIZE);
+        if(IS_ERR(page))
+            return PTR_ERR(page);
+        kaddr = kmap_local_page(page);
+        if(to_user){
+            left = copy_to_user(buf, kaddr + poff, chunk);
+        } else {
+            lock_page(page);
+            left = copy_from_user(kaddr + poff, buf, chunk);
+            set_page_dirty(page);
+            unlock_page(page);
+        }
+        kunmap_local(kaddr);
+        put_page(page);
+        if(left)
+            return -EFAULT;
+        buf += chunk;
+        off += chunk;
+        count -= chunk;
+    }
+    return 0;
+}
+
+/*把内核缓冲区 src 写到量子的 [off, off + count)，用于写入前已拷进临时缓冲区的数据*/
+static int hello_quantum_fill(struct hello_quantum *q, int off,
+                              const char *src, size_t count){
+    struct page *page;
+    char *kaddr;
+    size_t chunk, poff;
+
+    if(!q->shm){
+        memcpy(q->data + off, src, count);
+        return 0;
+    }
+
+    while(count){
+        poff = off % PAGE_SIZE;
+        chunk = min_t(size_t, count, PAGE_SIZE - poff);
+        page = shmem_read_mapping_page(q->shm->f_mapping, q->index + off / PAGE_SIZE);
+        if(IS_ERR(page))
+            return PTR_ERR(page);
+        kaddr = kmap_local_page(page);
+        lock_page(page);
+        memcpy(kaddr + poff, src, chunk);
+        set_page_dirty(page);
+        unlock_page(page);
+        kunmap_local(kaddr);
+        put_page(page);
+        src += chunk;
+        off += chunk;
+        count -= chunk;
+    }
+    return 0;
+}
+
+/*
+ * 量子的 [off, off + len) 是否全为零。memchr_inv 按字长批量比较，
+ * 比逐字节检查快得多
+ */
+static int hello_quantum_is_zero(struct hello_quantum *q, int off, int len){
+    struct page *page;
+    char *kaddr;
+    int chunk, poff, zero;
+
+    if(!q->shm)
+        return memchr_inv(q->data + off, 0, len) == NULL;
+
+    while(len > 0){
+        poff = off % PAGE_SIZE;
+        chunk = min_t(int, len, PAGE_SIZE - poff);
+        page = shmem_read_mapping_page(q->shm->f_mapping, q->index + off / PAGE_SIZE);
+        if(IS_ERR(page))
+            return 0;
+        kaddr = kmap_local_page(page);
+        zero = memchr_inv(kaddr + poff, 0, chunk) == NULL;
+        kunmap_local(kaddr);
+        put_page(page);
+        if(!zero)
+            return 0;
+        off += chunk;
+        len -= chunk;
+    }
+    return 1;
+}
+
+/*写时复制时把 src 的内容整块拷到新分配的 dst*/
+static int hello_quantum_copy(struct hello_quantum *dst,
+                              struct hello_quantum *src, int quantum){
+    struct page *spage, *dpage;
+    int i;
+
+    if(!src->shm){
+        memcpy(dst->data, src->data, quantum);
+        return 0;
+    }
+    for(i = 0; i < src->nr_pages; i++){
+        spage = shmem_read_mapping_page(src->shm->f_mapping, src->index + i);
+        if(IS_ERR(spage))
+            return PTR_ERR(spage);
+        dpage = shmem_read_mapping_page(dst->shm->f_mapping, dst->index + i);
+        if(IS_ERR(dpage)){
+            put_page(spage);
+            return PTR_ERR(dpage);
+        }
+        lock_page(dpage);
+        copy_highpage(dpage, spage);
+        set_page_dirty(dpage);
+        unlock_page(dpage);
+        put_page(dpage);
+        put_page(spage);
+    }
+    return 0;
+}
+
+static void hello_qset_put(struct hello_qset *dptr, int qset){
+    struct hello_qset *next;
+    int i;
+
+    for(; dptr && refcount_dec_and_test(&dptr->ref); dptr = next){
+        if(dptr->data){
+            for(i = 0; i < qset; i++){
+                hello_quantum_put(dptr->data[i]);
+            }
+            kfree(dptr->data);
+        }
+        next = dptr->next;
+        kfree(dptr);
+    }
+}
+
+/*保证 *slot 指向的量子集只属于当前设备，必要时复制一份*/
+static struct hello_qset *hello_qset_unshare(struct hello_qset **slot, int qset){
+    struct hello_qset *old = *slot, *qs;
+    int i;
+
+    if(hello_exclusive(&old->ref))
+        return old;
+    qs = kmalloc(sizeof(struct hello_qset), GFP_KERNEL);
+    if(!qs)
+        return NULL;
+    qs->data = NULL;
+    if(old->data){
+        qs->data = kmalloc(qset * sizeof(struct hello_quantum *), GFP_KERNEL);
+        if(!qs->data){
+            kfree(qs);
+            return NULL;
+        }
+        memcpy(qs->data, old->data, qset * sizeof(struct hello_quantum *));
+        for(i = 0; i < qset; i++){
+            if(qs->data[i])
+                refcount_inc(&qs->data[i]->ref);
+        }
+    }
+    qs->next = old->next;
+    if(qs->next)
+        refcount_inc(&qs->next->ref);
+    refcount_set(&qs->ref, 1);
+    *slot = qs;
+    hello_qset_put(old, qset);
+    return qs;
+}
+
+/*保证 *slot 指向的量子只属于当前量子集，必要时复制一份*/
+static struct hello_quantum *hello_quantum_unshare(struct hello_android_dev *dev,
+                                                   struct hello_quantum **slot){
+    struct hello_quantum *old = *slot, *q;
+
+    if(hello_exclusive(&old->ref))
+        return old;
+    q = hello_quantum_alloc(dev);
+    if(!q)
+        return NULL;
+    if(hello_quantum_copy(q, old, dev->quantum)){
+        hello_quantum_put(q);
+        return NULL;
+    }
+    *slot = q;
+    hello_quantum_put(old);
+    return q;
+}
+
+int hello_trim(struct hello_android_dev *dev){
+    hello_qset_put(dev->data, dev->qset);
+    dev->size = 0;
+    dev->quantum = hello_quantum;
+    dev->qset = hello_qset;
+    dev->data = NULL;
+    /*仍被快照共享的量子各自持有 shmem 文件的引用*/
+    if(dev->shm){
+        fput(dev->shm);
+        dev->shm = NULL;
+    }
+    return 0;
+}
+
+int hello_open(struct inode *inode, struct file *filp){
+    struct hello_android_dev *dev;
+    printk(KERN_ALERT "Debug by andrea: dev will open");
+    dev = container_of(inode->i_cdev, struct hello_android_dev, cdev);
+    filp->private_data = dev;
+    if ((filp->f_flags & O_ACCMODE) == O_WRONLY){
+        if (down_interruptible(&dev->sem)){
+            printk(KERN_WARNING "Debug by andrea: interrupt error when open");
+            return -ERESTARTSYS;
+        }
+        hello_trim(dev);
+        up(&dev->sem);
+    }
+    return 0;
+}
+
+int hello_release(struct inode *inode, struct file *filp){
+    printk(KERN_ALERT "Debug by andrea: dev will release");
+    return 0;
+}
+
+/*读路径只查找，不分配也不复制，共享的量子集不会被修改*/
+struct hello_qset *hello_lookup(struct hello_android_dev *dev, int n){
+    struct hello_qset *qs = dev->data;
+
+    while(qs && n--)
+        qs = qs->next;
+    return qs;
+}
+
+/*写路径：沿途补齐缺失的量子集，并把共享的量子集复制为私有*/
+struct hello_qset *hello_follow(struct hello_android_dev *dev, int n){
+    struct hello_qset **slot = &dev->data;
+    struct hello_qset *qs;
+
+    for(;;){
+        if(!*slot){
+            printk(KERN_ALERT "Debug by andrea: need re-malloc qset item");
+            qs = kmalloc(sizeof(struct hello_qset),GFP_KERNEL);
+            if(qs == NULL){
+                printk(KERN_WARNING "Debug by andrea: qset item re-malloc fail");
+                return NULL;
+            }
+            memset(qs, 0, sizeof(struct hello_qset));
+            refcount_set(&qs->ref, 1);
+            *slot = qs;
+        }
+        qs = hello_qset_unshare(slot, dev->qset);
+        if(qs == NULL){
+            printk(KERN_WARNING "Debug by andrea: qset copy on write fail");
+            return NULL;
+        }
+        if(!n--)
+            return qs;
+        slot = &qs->next;
+    }
+}
+
+ssize_t hello_read(struct file *filp,
+                   char __user *buf,
+                   size_t count,
+                   loff_t *f_pos){
+    struct hello_android_dev *dev = filp->private_data;
+    struct hello_qset *dptr;
+
+    int quantum = dev->quantum, qset = dev->qset;
+    int itemsize = quantum * qset;
+    int item, s_pos, q_pos, rest;
+    ssize_t retval = 0;
+
+    if(down_interruptible(&dev->sem)){
+        printk(KERN_WARNING "Debug by andrea: interrupt fail before read");
+        return -ERESTARTSYS;
+    }
+    if(*f_pos >= dev->size){
+        printk(KERN_WARNING "Debug by andrea: read position is overflow");
+        goto out;
+    }
+    if(*f_pos + count > dev->size){
+        printk(KERN_ALERT "Debug by andrea: read count is too much,need re-calculate");
+        count = dev->size - *f_pos;
+    }
+    item = (long)*f_pos / itemsize;
+    rest = (long)*f_pos % itemsize;
+    s_pos = rest / quantum;
+    q_pos = rest % quantum;
+
+    dptr = hello_lookup(dev, item);
+
+    if(count > quantum - q_pos){
+        printk(KERN_ALERT "Debug by andrea: read only up to the end of this quantum");
+        count = quantum - q_pos;
+    }
+
+    /*没有量子的地方是空洞，读出全零*/
+    if(dptr == NULL || !dptr->data || !dptr->data[s_pos]){
+        if(clear_user(buf, count)){
+            printk(KERN_WARNING "Debug by andrea: read hole fail");
+            retval = -EFAULT;
+            goto out;
+        }
+    } else {
+        retval = hello_quantum_copy_user(dptr->data[s_pos], q_pos, buf, count, 1);
+        if(retval){
+            printk(KERN_WARNING "Debug by andrea: read fail");
+            goto out;
+        }
+    }
+
+    *f_pos += count;
+    retval = count;
+out:
+    up(&dev->sem);
+    return retval;
+}
+
+ssize_t hello_write(struct file *filp,
+                    const char __user *buf,
+                    size_t count,
+                    loff_t *f_pos){
+    struct hello_android_dev *dev = filp->private_data;
+    struct hello_qset *dptr;
+    struct hello_quantum *q, *old;
+    char *bounce = NULL;
+
+    int quantum = dev->quantum, qset = dev->qset;
+    int itemsize = quantum * qset;
+    int item, s_pos, q_pos, rest;
+    ssize_t retval = -ENOMEM;
+
+    if(down_interruptible(&dev->sem)){
+        printk(KERN_WARNING "Debug by andrea: before write, interrupt fail");
+        return -ERESTARTSYS;
+    }
+    item = (long)*f_pos / itemsize;
+    rest = (long)*f_pos % itemsize;
+    s_pos = rest / quantum;
+    q_pos = rest % quantum;
+
+    dptr = hello_follow(dev, item);
+    if(dptr == NULL)
+        goto out;
+    if(!dptr->data){
+        printk(KERN_ALERT "Debug by andrea: need re-malloc qset->data");
+        dptr->data = kmalloc(qset * sizeof(struct hello_quantum *), GFP_KERNEL);
+        if(!dptr -> data){
+            printk(KERN_WARNING "Debug by andrea: re-malloc qset->data fail");
+            goto out;
+        }
+        memset(dptr->data,0,qset * sizeof(struct hello_quantum *));
+    }
+    if(count > quantum - q_pos){
+        printk(KERN_ALERT "Debug by andrea: write only up to the end of this quantum");
+        count = quantum -q_pos;
+    }
+    /*
+     * 写入空洞或整块覆盖共享的量子时，结果只取决于写入的数据：
+     * 先拷到临时缓冲区，全零就直接留下空洞，不分配量子也不复制
+     */
+    old = dptr->data[s_pos];
+    if(!old || (count == quantum && !hello_exclusive(&old->ref))){
+        bounce = kvmalloc(count, GFP_KERNEL);
+        if(!bounce)
+            goto out;
+        if(copy_from_user(bounce, buf, count)){
+            printk(KERN_WARNING "Debug by andrea: write fail");
+            retval = -EFAULT;
+            goto out;
+        }
+        if(!memchr_inv(bounce, 0, count)){
+            dptr->data[s_pos] = NULL;
+            hello_quantum_put(old);
+            goto done;
+        }
+        /*新量子不需要复制旧内容，写好后再替换，失败时旧数据不受影响*/
+        if(!old)
+            printk(KERN_ALERT "Debug by andrea: need re-malloc quantum");
+        q = hello_quantum_alloc(dev);
+        if(!q){
+            printk(KERN_WARNING "Debug by andrea: re-malloc quantum fail");
+            goto out;
+        }
+        retval = hello_quantum_fill(q, q_pos, bounce, count);
+        if(retval){
+            printk(KERN_WARNING "Debug by andrea: write fail");
+            hello_quantum_put(q);
+            goto out;
+        }
+        dptr->data[s_pos] = q;
+        hello_quantum_put(old);
+        goto done;
+    }
+    q = hello_quantum_unshare(dev, &dptr->data[s_pos]);
+    if(!q){
+        printk(KERN_WARNING "Debug by andrea: quantum copy on write fail");
+        goto out;
+    }
+    retval = hello_quantum_copy_user(q, q_pos, (char __user *)buf, count, 0);
+    if(retval){
+        printk(KERN_WARNING "Debug by andrea: write fail");
+        goto out;
+    }
+    /*写完后整个量子为零就释放掉，只留下空洞；先查刚写入的部分，通常很快就能排除*/
+    if(hello_quantum_is_zero(q, q_pos, count) &&
+       hello_quantum_is_zero(q, 0, q_pos) &&
+       hello_quantum_is_zero(q, q_pos + count, quantum - q_pos - count)){
+        dptr->data[s_pos] = NULL;
+        hello_quantum_put(q);
+    }
+done:
+    *f_pos += count;
+    retval = count;
+    if(dev->size < *f_pos){
+        printk(KERN_ALERT "Debug by andrea: update the size");
+        dev->size = *f_pos;
+    }
+out:
+    kvfree(bounce);
+    up(&dev->sem);
+    return retval;
+}
+
+/*
+ * 把 src 的内容快照到第 index 个设备，只增加链表头的引用计数，
+ * 之后任何一方写入时才复制被写的量子集和量子。
+ */
+static int hello_snapshot(struct hello_android_dev *src, int index){
+    struct hello_android_dev *dst, *first, *second;
+
+    if(index < 0 || index >= hello_nr_devs)
+        return -EINVAL;
+    dst = hello_dev + index;
+    if(dst == src)
+        return -EINVAL;
+
+    /*按地址顺序加锁，避免两个设备互相快照时死锁*/
+    first = src < dst ? src : dst;
+    second = src < dst ? dst : src;
+    if(down_interruptible(&first->sem))
+        return -ERESTARTSYS;
+    if(down_interruptible(&second->sem)){
+        up(&first->sem);
+        return -ERESTARTSYS;
+    }
+
+    hello_trim(dst);
+    if(src->data)
+        refcount_inc(&src->data->ref);
+    dst->data = src->data;
+    dst->quantum = src->quantum;
+    dst->qset = src->qset;
+    dst->size = src->size;
+
+    up(&second->sem);
+    up(&first->sem);
+    return 0;
+}
+
+long hello_ioctl(struct file *filp, unsigned int cmd, unsigned long arg){
+    struct hello_android_dev *dev = filp->private_data;
+
+    if(_IOC_TYPE(cmd) != HELLO_IOC_MAGIC || _IOC_NR(cmd) > HELLO_IOC_MAXNR)
+        return -ENOTTY;
+
+    switch(cmd){
+    case HELLO_IOCTSNAPSHOT:
+        if(!capable(CAP_SYS_ADMIN))
+            return -EPERM;
+        return hello_snapshot(dev, (int)arg);
+    case HELLO_IOCEXPORT:
+        /*导出后可以 mmap 读出内容，必须以读方式打开*/
+        if(!(filp->f_mode & FMODE_READ))
+            return -EBADF;
+        return hello_export(dev, (struct hello_export __user *)arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
+/*
+ * 调用者持有 dev->sem，统计存储实际占用的字节数：量子页加上量子集和指针数组。
+ * 空洞不占内存，快照共享的量子在每个设备中都计一次
+ */
+static unsigned long hello_store_physical(struct hello_android_dev *dev){
+    struct hello_qset *dptr;
+    unsigned long bytes = 0;
+    int i;
+
+    for(dptr = dev->data; dptr; dptr = dptr->next){
+        bytes += sizeof(struct hello_qset);
+        if(!dptr->data)
+            continue;
+        bytes += dev->qset * sizeof(struct hello_quantum *);
+        for(i = 0; i < dev->qset; i++){
+            if(dptr->data[i])
+                bytes += (unsigned long)dptr->data[i]->nr_pages << PAGE_SHIFT;
+        }
+    }
+    return bytes;
+}
+
+/*
+ * 逐页查看量子在 shmem 文件页缓存中的状态：页还在就是驻留，
+ * 位置上是 swap 表项就是被换出，两者都不是说明这页从未写过
+ */
+static void hello_quantum_usage(struct hello_quantum *q,
+                                unsigned long *resident,
+                                unsigned long *swapped){
+    void *entry;
+    int i;
+
+    if(!q->shm){
+        *resident += (unsigned long)q->nr_pages << PAGE_SHIFT;
+        return;
+    }
+    rcu_read_lock();
+    for(i = 0; i < q->nr_pages; i++){
+        entry = xa_load(&q->shm->f_mapping->i_pages, q->index + i);
+        if(!entry)
+            continue;
+        if(xa_is_value(entry))
+            *swapped += PAGE_SIZE;
+        else
+            *resident += PAGE_SIZE;
+    }
+    rcu_read_unlock();
+}
+
+/*
+ * 统计存储中驻留内存和被换出的字节数。和 hello_store_physical() 一样逐个量子统计，
+ * 所以快照共享的量子不管在哪个设备的 shmem 文件里，都会算进每个引用它的设备
+ */
+static int hello_store_usage(struct hello_android_dev *dev,
+                             unsigned long *resident,
+                             unsigned long *swapped){
+    struct hello_qset *dptr;
+    int i;
+
+    if(down_interruptible(&dev->sem))
+        return -ERESTARTSYS;
+    *resident = *swapped = 0;
+    for(dptr = dev->data; dptr; dptr = dptr->next){
+        if(!dptr->data)
+            continue;
+        for(i = 0; i < dev->qset; i++){
+            if(dptr->data[i])
+                hello_quantum_usage(dptr->data[i], resident, swapped);
+        }
+    }
+    up(&dev->sem);
+    return 0;
+}
+
+static ssize_t hello_resident_show(struct device *d,
+                                   struct device_attribute *attr,
+                                   char *buf){
+    struct hello_android_dev *dev = dev_get_drvdata(d);
+    unsigned long resident, swapped;
+    int err;
+
+    err = hello_store_usage(dev, &resident, &swapped);
+    if(err)
+        return err;
+    return snprintf(buf, PAGE_SIZE, "%lu\n", resident);
+}
+
+static ssize_t hello_swapped_show(struct device *d,
+                                  struct device_attribute *attr,
+                                  char *buf){
+    struct hello_android_dev *dev = dev_get_drvdata(d);
+    unsigned long resident, swapped;
+    int err;
+
+    err = hello_store_usage(dev, &resident, &swapped);
+    if(err)
+        return err;
+    return snprintf(buf, PAGE_SIZE, "%lu\n", swapped);
+}
+
+/*逻辑大小，包括空洞*/
+static ssize_t hello_logical_size_show(struct device *d,
+                                       struct device_attribute *attr,
+                                       char *buf){
+    struct hello_android_dev *dev = dev_get_drvdata(d);
+    unsigned long size;
+
+    if(down_interruptible(&dev->sem))
+        return -ERESTARTSYS;
+    size = dev->size;
+    up(&dev->sem);
+    return snprintf(buf, PAGE_SIZE, "%lu\n", size);
+}
+
+static ssize_t hello_physical_bytes_show(struct device *d,
+                                         struct device_attribute *attr,
+                                         char *buf){
+    struct hello_android_dev *dev = dev_get_drvdata(d);
+    unsigned long bytes;
+
+    if(down_interruptible(&dev->sem))
+        return -ERESTARTSYS;
+    bytes = hello_store_physical(dev);
+    up(&dev->sem);
+    return snprintf(buf, PAGE_SIZE, "%lu\n", bytes);
+}
+
+/*定义设备属性*/
+static DEVICE_ATTR(resident, S_IRUGO, hello_resident_show, NULL);
+static DEVICE_ATTR(swapped, S_IRUGO, hello_swapped_show, NULL);
+static DEVICE_ATTR(logical_size, S_IRUGO, hello_logical_size_show, NULL);
+static DEVICE_ATTR(physical_bytes, S_IRUGO, hello_physical_bytes_show, NULL);
+
+/*
+ * /proc/hello：逐个设备、逐个量子集输出存储布局。
+ * 文件偏移的高32位是设备号，低32位为0表示设备的概要行，n 表示第 n-1 个量子集。
+ * 迭代器持有当前量子集的引用：被引用的量子集是共享的，设备写入时会先复制，
+ * 所以沿着它的 next 往后走不需要设备的信号量，只有定位时短暂加锁。
+ * 引用只在一次 read() 内持有，stop 时放掉，否则打开文件不读的用户会让写者一直复制、
+ * 旧的存储也一直无法释放。每次 read() 由 start 重新定位，seq_file 每次会输出一整页记录。
+ */
+#define HELLO_PROC_POS(dev, n) (((loff_t)(dev) << 32) | (n))
+#define HELLO_PROC_DEV(pos)    ((int)((pos) >> 32))
+#define HELLO_PROC_QSET(pos)   ((int)((pos) & 0xffffffff) - 1)
+
+struct hello_proc_iter {
+    int dev;
+    int n; /*-1 表示概要行*/
+    struct hello_qset *qs; /*持有引用*/
+    unsigned long size; /*定位到该设备时的数据量和几何参数*/
+    int quantum;
+    int qset;
+};
+
+static void hello_proc_iter_put(struct hello_proc_iter *it){
+    hello_qset_put(it->qs, it->qset);
+    it->qs = NULL;
+}
+
+/*定位到 pos，只在加锁期间从链表头走到第 n 个量子集，找不到就转到下一个设备*/
+static void *hello_proc_seek(struct hello_proc_iter *it, loff_t *pos){
+    struct hello_android_dev *dev;
+    int i, n;
+
+    hello_proc_iter_put(it);
+    for(;;){
+        i = HELLO_PROC_DEV(*pos);
+        n = HELLO_PROC_QSET(*pos);
+        if(i >= hello_nr_devs)
+            return NULL;
+        dev = hello_dev + i;
+        if(down_interruptible(&dev->sem))
+            return ERR_PTR(-ERESTARTSYS);
+        it->size = dev->size;
+        it->quantum = dev->quantum;
+        it->qset = dev->qset;
+        if(n >= 0){
+            it->qs = hello_lookup(dev, n);
+            if(it->qs)
+                refcount_inc(&it->qs->ref);
+        }
+        up(&dev->sem);
+        if(n < 0 || it->qs)
+            break;
+        *pos = HELLO_PROC_POS(i + 1, 0);
+    }
+    it->dev = i;
+    it->n = n;
+    return it;
+}
+
+static void *hello_seq_start(struct seq_file *s, loff_t *pos){
+    return hello_proc_seek(s->private, pos);
+}
+
+static void *hello_seq_next(struct seq_file *s, void *v, loff_t *pos){
+    struct hello_proc_iter *it = v;
+    struct hello_qset *next;
+
+    if(it->n < 0){
+        *pos = HELLO_PROC_POS(it->dev, 1);
+        return hello_proc_seek(it, pos);
+    }
+    next = it->qs->next;
+    if(!next){
+        *pos = HELLO_PROC_POS(it->dev + 1, 0);
+        return hello_proc_seek(it, pos);
+    }
+    /*当前量子集持有 next 的引用，先引用 next 再放掉当前的*/
+    refcount_inc(&next->ref);
+    hello_qset_put(it->qs, it->qset);
+    it->qs = next;
+    it->n++;
+    *pos = HELLO_PROC_POS(it->dev, it->n + 1);
+    return it;
+}
+
+static void hello_seq_stop(struct seq_file *s, void *v){
+    hello_proc_iter_put(s->private);
+}
+
+static int hello_seq_show(struct seq_file *s, void *v){
+    struct hello_proc_iter *it = v;
+    struct hello_qset *dptr = it->qs;
+    struct hello_quantum *q;
+    unsigned long start;
+    int j, used, quanta = 0, holes = 0, shared = 0;
+
+    if(it->n < 0){
+        if(it->dev == 0)
+            seq_printf(s, "%s:", HELLO_DEVICE_FILE_NAME);
+        else
+            seq_printf(s, "%s%d:", HELLO_DEVICE_FILE_NAME, it->dev);
+        seq_printf(s, " size %lu quantum %d qset %d\n",
+                   it->size, it->quantum, it->qset);
+        return 0;
+    }
+
+    /*这个量子集中落在数据量以内的量子数，其中缺失的就是空洞*/
+    start = (unsigned long)it->n * it->qset * it->quantum;
+    used = 0;
+    if(it->size > start)
+        used = min_t(unsigned long, it->qset,
+                     DIV_ROUND_UP(it->size - start, it->quantum));
+    for(j = 0; dptr->data && j < it->qset; j++){
+        q = dptr->data[j];
+        if(q){
+            quanta++;
+            if(refcount_read(&q->ref) > 1)
+                shared++;
+        } else if(j < used){
+            holes++;
+        }
+    }
+    if(!dptr->data)
+        holes = used;
+    /*迭代器自己也持有一个引用*/
+    seq_printf(s, "  qset %d: quanta %d holes %d/%d shared %d%s\n",
+               it->n, quanta, holes, used, shared,
+               refcount_read(&dptr->ref) > 2 ? " (qset shared)" : "");
+    return 0;
+}
+
+static const struct seq_operations hello_seq_ops = {
+    .start = hello_seq_start,
+    .next  = hello_seq_next,
+    .stop  = hello_seq_stop,
+    .show  = hello_seq_show,
+};
+
+static int hello_proc_open(struct inode *inode, struct file *file){
+    return seq_open_private(file, &hello_seq_ops, sizeof(struct hello_proc_iter));
+}
+
+static const struct proc_ops hello_proc_ops = {
+    .proc_open    = hello_proc_open,
+    .proc_read    = seq_read,
+    .proc_lseek   = seq_lseek,
+    .proc_release = seq_release_private,
+};
+
+static void hello_setup_cdev(struct hello_android_dev *dev,
+                             int index){
+    int err, devno = MKDEV(hello_major,hello_minor + index);
+    printk(KERN_ALERT "Debug by andrea: setup cdev");
+    cdev_init(&dev->cdev,&hello_fops);
+    dev->cdev.owner = THIS_MODULE;
+    dev->cdev.ops = &hello_fops;
+    err = cdev_add(&dev->cdev, devno, 1);
+    if(err){
+        printk(KERN_WARNING "Debug by andrea: Error %d adding hello %d", err, index);
+    }
+}
+
+void hello_cleanup_module(void){
+    int i;
+    dev_t devno = MKDEV(hello_major,hello_minor);
+    proc_remove(hello_proc_entry);
+    hello_access_cleanup();
+    hello_log_cleanup();
+    if(hello_class){
+        for(i = 0; i < hello_nr_devs; i++){
+            device_destroy(hello_class, devno + i);
+        }
+        class_destroy(hello_class);
+    }
+    if(hello_dev){
+        for(i = 0; i < hello_nr_devs; i++){
+            hello_trim(hello_dev + i);
+            cdev_del(&hello_dev[i].cdev);
+        }
+        kfree(hello_dev);
+    }
+    unregister_chrdev_region(devno,hello_total_devs());
+}
+
+static int __init hello_init(void){
+    int result, i;
+    dev_t dev = 0;
+    struct device *temp = NULL;
+
+    printk(KERN_ALERT "Debug by andrea: hello_init()");
+
+    /*量子和量子集大小用作除数，乘积要放得下 int；日志记录头也要放得进一个量子*/
+    if(hello_nr_devs <= 0 || hello_qset <= 0 ||
+       hello_quantum <= (int)(sizeof(struct hello_log_rec) + sizeof(__u64)) ||
+       hello_qset > INT_MAX / hello_quantum){
+        printk(KERN_WARNING "Debug by andrea: invalid nr_devs %d quantum %d qset %d",
+               hello_nr_devs, hello_quantum, hello_qset);
+        return -EINVAL;
+    }
+
+    if(hello_major){
+        printk(KERN_ALERT "Debug by andrea: static asign dev id");
+        dev = MKDEV(hello_major, hello_minor);
+        result = register_chrdev_region(dev,
+                                        hello_total_devs(),
+                                        "hello");
+    } else {
+        printk(KERN_ALERT "Debug by Andrea: dymanic asing dev id");
+        result = alloc_chrdev_region(&dev,
+                                     hello_minor,
+                                     hello_total_devs(),
+                                     "hello");
+        hello_major = MAJOR(dev);
+    }
+
+    if(result < 0){
+        printk(KERN_WARNING "Debug by Andrea: can't get major %d\n", hello_major);
+        return result;
+    }
+
+    printk(KERN_ALERT "Debug by Andrea: malloc for hello_android_dev");
+    hello_dev = kmalloc(hello_nr_devs *
+                        sizeof(struct hello_android_dev),GFP_KERNEL);
+
+    if(!hello_dev){
+        printk(KERN_WARNING "Debug by Andrea: malloc hello_android_dev fail");
+        result = -ENOMEM;
+        goto fail;
+    }
+    /*hello_dev 内存清零*/
+    memset(hello_dev, 0, hello_nr_devs * sizeof(struct hello_android_dev));
+    for(i = 0; i < hello_nr_devs; i++){
+        hello_dev[i].quantum = hello_quantum;
+        hello_dev[i].qset = hello_qset;
+        sema_init(&hello_dev[i].sem,1);
+        hello_setup_cdev(&hello_dev[i],i);
+    }
+
+    hello_class = class_create(THIS_MODULE,HELLO_DEVICE_CLASS_NAME);
+    if(IS_ERR(hello_class)){
+        result = PTR_ERR(hello_class);
+        hello_class = NULL;
+        printk(KERN_WARNING "Debug by andrea: Failed to create hello class");
+        goto fail;
+    }
+
+    /*第0个设备保持原来的 /dev/hello，其余的为 /dev/hello1 ...，作为快照的目标*/
+    for(i = 0; i < hello_nr_devs; i++){
+        if(i == 0)
+            temp = device_create(hello_class, NULL, dev, hello_dev, "%s", HELLO_DEVICE_FILE_NAME);
+        else
+            temp = device_create(hello_class, NULL, dev + i, hello_dev + i, "%s%d", HELLO_DEVICE_FILE_NAME, i);
+        if(IS_ERR(temp)) {
+            result = PTR_ERR(temp);
+            printk(KERN_ALERT"Failed to create hello device.");
+            goto fail;
+        }
+        /*在/sys/class/hello/hello*目录下创建属性文件*/
+        result = device_create_file(temp, &dev_attr_resident);
+        if(result == 0)
+            result = device_create_file(temp, &dev_attr_swapped);
+        if(result == 0)
+            result = device_create_file(temp, &dev_attr_logical_size);
+        if(result == 0)
+            result = device_create_file(temp, &dev_attr_physical_bytes);
+        if(result < 0){
+            printk(KERN_ALERT"Failed to create attributes.");
+            goto fail;
+        }
+    }
+
+    /*日志设备紧跟在普通设备之后*/
+    result = hello_log_init(MKDEV(hello_major, hello_minor + hello_nr_devs));
+    if(result < 0){
+        printk(KERN_WARNING "Debug by andrea: Failed to setup hello log devices");
+        goto fail;
+    }
+
+    result = hello_access_init(MKDEV(hello_major,
+                                     hello_minor + hello_nr_devs + hello_log_nr_devs));
+    if(result < 0){
+        printk(KERN_WARNING "Debug by andrea: Failed to setup hello private device");
+        goto fail;
+    }
+
+    /*创建/proc/hello文件，失败不影响设备使用*/
+    hello_proc_entry = proc_create(HELLO_DEVICE_PROC_NAME, 0, NULL, &hello_proc_ops);
+    if(!hello_proc_entry)
+        printk(KERN_WARNING "Debug by andrea: Failed to create /proc/hello");
+    return 0;
+
+fail:
+    printk(KERN_WARNING "Debug by andrea: module init fail, program will cleanup now");
+    hello_cleanup_module();
+    return result;
+}
+
+static void __exit hello_exit(void){
+    printk(KERN_ALERT "Debug by andrea: module exit, program will cleanup now");
+    hello_cleanup_module();
+}
+
+module_init(hello_init);
+module_exit(hello_exit);
@@ -157,30 +157,38 @@ static ssize_t hello_val_store(struct device* dev, struct device_attribute* attr
 	return __hello_set_val(hdev, buf, count);
 }
 
-/*读取设备寄存器val的值，保存在page缓冲区中*/
-/*
-static ssize_t hello_proc_read(char* page, char** start, off_t off, int count, int* eof, void* data) {
-	if(off > 0) {
-		*eof = 1;
-		return 0;
+/*读取设备寄存器val的值，输出到/proc/hello中*/
+static int hello_proc_show(struct seq_file* m, void* v) {
+	struct hello_android_dev* dev = m->private;
+	int val = 0;
+
+	/*同步访问*/
+	if(down_interruptible(&(dev->sem))) {
+		return -ERESTARTSYS;
 	}
 
-	return __hello_get_val(hello_dev, page);
+	val = dev->val;
+	up(&(dev->sem));
+
+	seq_printf(m, "%d\n", val);
+	return 0;
+}
+
+static int hello_proc_open(struct inode* inode, struct file* filp) {
+	return single_open(filp, hello_proc_show, hello_dev);
 }
-*/
 
 /*把缓冲区的值buff保存到设备寄存器val中去*/
-/*
-static ssize_t hello_proc_write(struct file* filp, const char __user *buff, unsigned long len, void* data) {
-	int err = 0;
+static ssize_t hello_proc_write(struct file* filp, const char __user *buff, size_t len, loff_t* off) {
+	ssize_t err = 0;
 	char* page = NULL;
 
-	if(len > PAGE_SIZE) {
-		printk(KERN_ALERT"The buff is too large: %lu.\n", len);
+	if(len >= PAGE_SIZE) {
+		printk(KERN_ALERT"The buff is too large: %zu.\n", len);
 		return -EFAULT;
 	}
 
-	page = (char*)__get_free_page(GFP_KERNEL);
+	page = (char*)get_zeroed_page(GFP_KERNEL);
 	if(!page) {
 		printk(KERN_ALERT"Failed to alloc page.\n");
 		return -ENOMEM;
@@ -198,58 +206,30 @@ out:
 	free_page((unsigned long)page);
 	return err;
 }
-*/
 
-/*原文章中的代码在3.4以上的内核不能编译通过，现仿照goldfish/driver/acpi/proc.c 中的方式修改创建/proc/hello文件的代码*/
+/*create_proc_entry在3.10以后被移除，改用proc_create和seq_file*/
+static const struct proc_ops hello_proc_ops = {
+	.proc_open = hello_proc_open,
+	.proc_read = seq_read,
+	.proc_lseek = seq_lseek,
+	.proc_release = single_release,
+	.proc_write = hello_proc_write,
+};
 
 /*创建/proc/hello文件*/
-/*
 static void hello_create_proc(void) {
 	struct proc_dir_entry* entry;
 
-	entry = create_proc_entry(HELLO_DEVICE_PROC_NAME, 0, NULL);
-	if(entry) {
-		entry->owner = THIS_MODULE;
-		entry->read_proc = hello_proc_read;
-		entry->write_proc = hello_proc_write;
-	}
-}
-*/
-
-/*
-static void hello_create_proc(void) {
-	struct proc_dir_entry* entry;
-
-	entry = create_proc_entry(HELLO_DEVICE_PROC_NAME, 0, NULL);
-	if(entry) {
-		entry->owner = THIS_MODULE;
-		entry->read_proc = hello_proc_read;
-		entry->write_proc = hello_proc_write;
-	}
-}
-*/
-
-/*
-static struct file_operations hello_proc_ops = {
-	.owner   = THIS_MODULE,
-};
-
-static void hello_create_proc(void) {
-	struct proc_dir_entry* entry;
-	entry = proc_create(HELLO_DEVICE_PROC_NAME,0,NULL,&hello_proc_ops);
-	if(entry){
-		entry->read_proc = hello_proc_read;
-		entry->write_proc = hello_proc_write;
+	entry = proc_create(HELLO_DEVICE_PROC_NAME, S_IRUGO | S_IWUSR, NULL, &hello_proc_ops);
+	if(!entry) {
+		printk(KERN_ALERT"Failed to create /proc/hello.\n");
 	}
 }
-*/
 
 /*删除/proc/hello文件*/
-/*
 static void hello_remove_proc(void) {
 	remove_proc_entry(HELLO_DEVICE_PROC_NAME, NULL);
 }
-*/
 
 /*初始化设备*/
 static int  __hello_setup_dev(struct hello_android_dev* dev) {
@@ -335,7 +315,7 @@ static int __init hello_init(void){
 	dev_set_drvdata(temp, hello_dev);
 
 	/*创建/proc/hello文件*/
-	/*hello_create_proc();*/
+	hello_create_proc();
 
 	printk(KERN_ALERT"Succedded to initialize hello device.\n");
 	return 0;
@@ -366,7 +346,7 @@ static void __exit hello_exit(void) {
 	printk(KERN_ALERT"Destroy hello device.\n");
 
 	/*删除/proc/hello文件*/
-	/*hello_remove_proc();*/
+	hello_remove_proc();
 
 	/*销毁设备类别和设备*/
 	if(hello_class) {